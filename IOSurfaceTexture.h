@@ -1,10 +1,14 @@
 #pragma once
+#include <chrono>
 #include <exception>
+#include <unistd.h>
+#include <sys/sysctl.h>
 #include <CoreVideo/CoreVideo.h>
 #include <IOSurface/IOSurface.h>
 #include <OpenGL/CGLIOSurface.h>
 #include <OpenGL/OpenGL.h>
 #include <OpenGL/gl3.h>
+#include "framehash.h"
 
 #define CV_CHECK(...) \
     do { \
@@ -26,6 +30,14 @@ public:
         BGRA = 'BGRA',
     };
 
+    // 行对齐方式, 缓存行和页的大小在运行时查询 (Apple Silicon 上分别为 128 字节和 16K)
+    enum RowAlignment
+    {
+        Default,      // 由系统决定行跨度
+        CacheLine,    // 按缓存行对齐, 并避开页大小整数倍的跨度以减少缓存组冲突
+        Page,         // 按页对齐
+    };
+
 private:
     IOSurfaceRef m_surface = nullptr;
     CVPixelBufferRef m_pixelBuffer = nullptr;
@@ -33,16 +45,58 @@ private:
     CVOpenGLTextureRef m_texture = nullptr;
     int m_width = 0;
     int m_height = 0;
+    int m_bytesPerRow = 0;
+    size_t m_allocSize = 0;
     Format m_format = Format::BGRA;
 
     GLuint m_textureid = 0;
     GLuint m_target = 0;
 
 private:
+    static size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static size_t getCacheLineSize()
+    {
+        int64_t cacheLineSize = 0;
+        size_t size = sizeof(cacheLineSize);
+        if (sysctlbyname("hw.cachelinesize", &cacheLineSize, &size, nullptr, 0) != 0 || cacheLineSize <= 0)
+            return 64;
+        return (size_t)cacheLineSize;
+    }
+
+    static size_t getPageSize()
+    {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        return pageSize > 0 ? (size_t)pageSize : 4096;
+    }
+
+    // 计算行跨度, 返回 0 表示由系统决定
+    static size_t computeBytesPerRow(int width, int bytesPerElement, RowAlignment rowAlignment)
+    {
+        if (rowAlignment == RowAlignment::Default)
+            return 0;
+
+        size_t cacheLineSize = getCacheLineSize();
+        size_t pageSize = getPageSize();
+        size_t alignment = rowAlignment == RowAlignment::Page ? pageSize : cacheLineSize;
+
+        size_t bytesPerRow = alignUp((size_t)width * bytesPerElement, alignment);
+
+        // 跨度为页大小整数倍时, 同一列的像素会落在相同的缓存组上, 多补一个缓存行错开
+        if (rowAlignment == RowAlignment::CacheLine && bytesPerRow % pageSize == 0)
+            bytesPerRow += cacheLineSize;
+
+        return IOSurfaceAlignProperty(kIOSurfaceBytesPerRow, bytesPerRow);
+    }
+
     // 创建 IOSurface
-    static IOSurfaceRef createIOSurface(int width, int height, Format pixelFormat = Format::BGRA)
+    static IOSurfaceRef createIOSurface(int width, int height, Format pixelFormat = Format::BGRA, RowAlignment rowAlignment = RowAlignment::Default)
     {
         int bytesPerElement = 4;
+        size_t bytesPerRow = computeBytesPerRow(width, bytesPerElement, rowAlignment);
 
         CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
                                         &kCFTypeDictionaryKeyCallBacks,
@@ -59,6 +113,20 @@ private:
         CFDictionarySetValue(dict, kIOSurfacePixelFormat, pixelFormatRef);
         CFDictionarySetValue(dict, kIOSurfaceIsGlobal, kCFBooleanTrue);
 
+        if (bytesPerRow != 0)
+        {
+            size_t allocSize = IOSurfaceAlignProperty(kIOSurfaceAllocSize, bytesPerRow * height);
+
+            CFNumberRef bytesPerRowRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongType, &bytesPerRow);
+            CFNumberRef allocSizeRef = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongType, &allocSize);
+
+            CFDictionarySetValue(dict, kIOSurfaceBytesPerRow, bytesPerRowRef);
+            CFDictionarySetValue(dict, kIOSurfaceAllocSize, allocSizeRef);
+
+            CFRelease(bytesPerRowRef);
+            CFRelease(allocSizeRef);
+        }
+
         IOSurfaceRef surface = IOSurfaceCreate(dict);
 
         CFRelease(dict);
@@ -96,6 +164,12 @@ private:
         m_surface = surface;
         m_width = (int)IOSurfaceGetWidth(surface);
         m_height = (int)IOSurfaceGetHeight(surface);
+        m_bytesPerRow = (int)IOSurfaceGetBytesPerRow(surface);
+        m_allocSize = IOSurfaceGetAllocSize(surface);
+
+        // 打印 surface 实际分配的大小
+        printf("Surface alloc size: %zu bytes\n", m_allocSize);
+
         m_textureid = CVOpenGLTextureGetName(m_texture);
         m_target = CVOpenGLTextureGetTarget(m_texture);
 
@@ -117,9 +191,9 @@ public:
         init(surface);
     }
 
-    IOSurfaceTexture(int width, int height, Format format)
+    IOSurfaceTexture(int width, int height, Format format, RowAlignment rowAlignment = RowAlignment::Default)
     {
-        init(createIOSurface(width, height, format));
+        init(createIOSurface(width, height, format, rowAlignment));
     }
 
     ~IOSurfaceTexture()
@@ -166,11 +240,144 @@ public:
         return m_height;
     }
 
+    int GetBytesPerRow() const
+    {
+        return m_bytesPerRow;
+    }
+
+    size_t GetAllocSize() const
+    {
+        return m_allocSize;
+    }
+
     Format GetFormat() const
     {
         return m_format;
     }
 
+    // CPU 访问像素前需要先加锁, 访问结束后解锁
+    void Lock(bool readOnly = false)
+    {
+        kern_return_t ret = IOSurfaceLock(m_surface, readOnly ? kIOSurfaceLockReadOnly : 0, nullptr);
+        if (ret != kIOReturnSuccess)
+            throw std::runtime_error("IOSurfaceLock failure: " + std::to_string(ret));
+    }
+
+    void Unlock(bool readOnly = false)
+    {
+        kern_return_t ret = IOSurfaceUnlock(m_surface, readOnly ? kIOSurfaceLockReadOnly : 0, nullptr);
+        if (ret != kIOReturnSuccess)
+            throw std::runtime_error("IOSurfaceUnlock failure: " + std::to_string(ret));
+    }
+
+    uint8_t* GetBaseAddress() const
+    {
+        return (uint8_t*)IOSurfaceGetBaseAddress(m_surface);
+    }
+
+    // 按行跨度寻址, 调用者无需关心行尾的填充
+    uint8_t* GetRow(int y) const
+    {
+        return GetBaseAddress() + (size_t)y * m_bytesPerRow;
+    }
+
+    uint32_t* GetPixel(int x, int y) const
+    {
+        return (uint32_t*)GetRow(y) + x;
+    }
+
+    // 计算当前帧的哈希, 只覆盖每行的有效像素, 不包括行尾填充
+    uint64_t ComputeFrameHash()
+    {
+        size_t rowSize = (size_t)m_width * 4;
+        FrameHasher hasher;
+
+        Lock(true);
+        if (rowSize == (size_t)m_bytesPerRow)
+        {
+            hasher.Update(GetBaseAddress(), rowSize * m_height);
+        }
+        else
+        {
+            for (int y = 0; y < m_height; y++)
+            {
+                hasher.Update(GetRow(y), rowSize);
+            }
+        }
+        Unlock(true);
+
+        return hasher.Digest();
+    }
+
+    void SetFrameStamp(const FrameStamp& stamp)
+    {
+        CFDataRef data = CFDataCreate(kCFAllocatorDefault, (const UInt8*)&stamp, sizeof(stamp));
+        IOSurfaceSetValue(m_surface, CFSTR("FrameStamp"), data);
+        CFRelease(data);
+    }
+
+    bool GetFrameStamp(FrameStamp& stamp) const
+    {
+        CFTypeRef value = IOSurfaceCopyValue(m_surface, CFSTR("FrameStamp"));
+        if (value == nullptr)
+            return false;
+
+        bool ok = CFGetTypeID(value) == CFDataGetTypeID() && CFDataGetLength((CFDataRef)value) == sizeof(stamp);
+        if (ok)
+            memcpy(&stamp, CFDataGetBytePtr((CFDataRef)value), sizeof(stamp));
+
+        CFRelease(value);
+        return ok;
+    }
+
+    // 生产者: 开始渲染第 frameNumber 帧之前调用, 标记 surface 正在写入
+    void BeginFrame(uint64_t frameNumber)
+    {
+        FrameStamp stamp;
+        stamp.sequence = frameNumber * 2 - 1;
+        SetFrameStamp(stamp);
+    }
+
+    // 生产者: 帧渲染完成 (fence 已完成) 后调用, 写入哈希
+    void PublishFrame(uint64_t frameNumber)
+    {
+        FrameStamp stamp;
+        stamp.sequence = frameNumber * 2;
+        stamp.hash = ComputeFrameHash();
+        SetFrameStamp(stamp);
+    }
+
+    // 消费者: before 是采样 surface 之前读到的 stamp, 采样并 glFinish 之后调用.
+    // 先哈希再分类, 返回 true 表示显示的是完整的新帧
+    bool VerifyFrame(const FrameStamp& before, FrameStats& stats)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        uint64_t hash = ComputeFrameHash();
+        stats.hashTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        // 前后 stamp 相同且为偶数, 说明采样和哈希期间生产者没有写入
+        FrameStamp after;
+        if (before.IsWriting() || !GetFrameStamp(after) || after.sequence != before.sequence || hash != before.hash)
+        {
+            stats.torn++;
+            return false;
+        }
+
+        uint64_t frameNumber = before.GetFrameNumber();
+        if (frameNumber == stats.lastFrameNumber)
+        {
+            stats.stale++;
+            return false;
+        }
+
+        if (stats.lastFrameNumber != 0 && frameNumber > stats.lastFrameNumber + 1)
+            stats.dropped += frameNumber - stats.lastFrameNumber - 1;
+        stats.lastFrameNumber = frameNumber;
+
+        stats.verified++;
+        return true;
+    }
+
     GLuint GetTexture() const
     {
         return m_textureid;
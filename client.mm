@@ -71,6 +71,10 @@ int main(int argc, const char * argv[])
     std::shared_ptr<ImageRenderer> renderer;
     int pid = 0;
 
+    bool integrity = argc > 1 && std::string(argv[1]) == "--integrity";
+    FrameStats frameStats;
+    uint64_t frameCount = 0;
+
     while (true) {
         auto startTime = std::chrono::high_resolution_clock::now();
 
@@ -90,20 +94,35 @@ int main(int argc, const char * argv[])
             int viewWidth = viewFrame.size.width;
             int viewHeight = viewFrame.size.height;
 
-            surfaceTexture = std::make_shared<IOSurfaceTexture>(viewWidth, viewHeight, IOSurfaceTexture::Format::BGRA);
+            surfaceTexture = std::make_shared<IOSurfaceTexture>(viewWidth, viewHeight, IOSurfaceTexture::Format::BGRA, IOSurfaceTexture::RowAlignment::CacheLine);
 
             auto tex = std::make_shared<GLTexture>(surfaceTexture->GetTexture(), surfaceTexture->GetWidth(), surfaceTexture->GetHeight(), GL_BGRA, surfaceTexture->GetTarget());
             renderer->SetTexture(tex);
 
-            pid = execCommand("./build/Debug/server " + std::to_string(surfaceTexture->GetSurfaceID()));
+            pid = execCommand("./build/Debug/server " + std::to_string(surfaceTexture->GetSurfaceID()) + (integrity ? " --integrity" : ""));
         }
 
+        // 采样 surface 之前先读 stamp, 采样完成后再校验, 证明显示的就是这一帧
+        FrameStamp stamp;
+        bool verify = integrity && surfaceTexture->GetFrameStamp(stamp);
+
         GL_CHECK(glClearColor(1.0f, 0.0f, 0.0f, 1.0f));
         GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
 
         renderer->OnRender();
         
         GL_CHECK(glFinish());
+
+        if (verify)
+        {
+            surfaceTexture->VerifyFrame(stamp, frameStats);
+            if (++frameCount % 60 == 0)
+            {
+                printf("client frames: verified %llu, torn %llu, stale %llu, dropped %llu, hashTime: %.3f ms\n",
+                       frameStats.verified, frameStats.torn, frameStats.stale, frameStats.dropped, frameStats.hashTime / frameCount);
+            }
+        }
+
         GL_CHECK(glFlush());
 
         [appDelegate.openGLContext flushBuffer];
@@ -0,0 +1,450 @@
+#pragma once
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <sys/event.h>
+#include <unistd.h>
+#include <OpenGL/OpenGL.h>
+#include <OpenGL/gl3.h>
+
+// 协程任务, 创建后挂起, 由 EventLoop::Spawn 启动或被其他协程 co_await
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::coroutine_handle<> m_continuation;
+        std::exception_ptr m_exception;
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+            // 结束时恢复等待者
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    auto continuation = handle.promise().m_continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+            return FinalAwaiter{};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            m_exception = std::current_exception();
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    friend class EventLoop;
+
+public:
+    Task(Task&& other) noexcept : m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle)
+                m_handle.destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    bool IsDone() const
+    {
+        return !m_handle || m_handle.done();
+    }
+
+    bool await_ready() const
+    {
+        return IsDone();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+    {
+        m_handle.promise().m_continuation = continuation;
+        return m_handle;
+    }
+
+    void await_resume()
+    {
+        if (m_handle && m_handle.promise().m_exception)
+            std::rethrow_exception(m_handle.promise().m_exception);
+    }
+};
+
+// 基于 kqueue 的单线程事件循环, 所有等待都在一次 kevent 调用中完成, 不需要轮询
+class EventLoop
+{
+private:
+    int m_kq = -1;
+    uintptr_t m_nextTimerId = 1;
+    int m_pending = 0;
+    std::vector<Task> m_tasks;
+    std::unordered_set<int> m_readWaiters;
+
+    // 其他线程投递过来等待恢复的协程, 通过 EVFILT_USER 唤醒事件循环
+    std::mutex m_postedMutex;
+    std::vector<std::coroutine_handle<>> m_posted;
+
+    // 注册一次性事件, 事件触发时恢复协程
+    void watch(uintptr_t ident, int16_t filter, uint32_t fflags, intptr_t data, std::coroutine_handle<> handle)
+    {
+        struct kevent ev;
+        EV_SET(&ev, ident, filter, EV_ADD | EV_ONESHOT, fflags, data, handle.address());
+        if (kevent(m_kq, &ev, 1, nullptr, 0, nullptr) == -1)
+            throw std::runtime_error("kevent failure: " + std::to_string(errno));
+
+        m_pending++;
+    }
+
+public:
+    struct SleepAwaiter
+    {
+        EventLoop& loop;
+        std::chrono::nanoseconds duration;
+
+        bool await_ready() const
+        {
+            return duration.count() <= 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            loop.watch(loop.m_nextTimerId++, EVFILT_TIMER, NOTE_NSECONDS, (intptr_t)duration.count(), handle);
+        }
+
+        void await_resume() {}
+    };
+
+    struct ReadableAwaiter
+    {
+        EventLoop& loop;
+        int fd;
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            // 同一个 fd 上重复注册会覆盖前一个等待者, 前一个协程将永远无法恢复
+            if (!loop.m_readWaiters.insert(fd).second)
+                throw std::runtime_error("fd " + std::to_string(fd) + " already has a reader");
+
+            try
+            {
+                loop.watch((uintptr_t)fd, EVFILT_READ, 0, 0, handle);
+            }
+            catch (...)
+            {
+                loop.m_readWaiters.erase(fd);
+                throw;
+            }
+        }
+
+        void await_resume() {}
+    };
+
+    EventLoop()
+    {
+        m_kq = kqueue();
+        if (m_kq == -1)
+            throw std::runtime_error("kqueue failure: " + std::to_string(errno));
+
+        struct kevent ev;
+        EV_SET(&ev, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        if (kevent(m_kq, &ev, 1, nullptr, 0, nullptr) == -1)
+        {
+            int error = errno;
+            close(m_kq);
+            m_kq = -1;
+            throw std::runtime_error("kevent failure: " + std::to_string(error));
+        }
+    }
+
+    ~EventLoop()
+    {
+        m_tasks.clear();
+        if (m_kq != -1)
+        {
+            close(m_kq);
+            m_kq = -1;
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // 等待一段时间
+    SleepAwaiter Sleep(std::chrono::nanoseconds duration)
+    {
+        return SleepAwaiter{*this, duration};
+    }
+
+    // 等待到指定时间点
+    SleepAwaiter SleepUntil(std::chrono::steady_clock::time_point time)
+    {
+        return SleepAwaiter{*this, time - std::chrono::steady_clock::now()};
+    }
+
+    // 等待文件描述符可读, 用于管道或 socket 上的控制消息
+    ReadableAwaiter Readable(int fd)
+    {
+        return ReadableAwaiter{*this, fd};
+    }
+
+    // 协程挂起后交给其他线程等待时, 先在事件循环线程上计数, 完成后由该线程调用 Post
+    void BeginExternalWait()
+    {
+        m_pending++;
+    }
+
+    // 线程安全, 在事件循环线程上恢复协程
+    void Post(std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_postedMutex);
+            m_posted.push_back(handle);
+        }
+
+        struct kevent ev;
+        EV_SET(&ev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+        kevent(m_kq, &ev, 1, nullptr, 0, nullptr);
+    }
+
+    // 启动一个顶层任务
+    void Spawn(Task task)
+    {
+        auto handle = task.m_handle;
+        m_tasks.push_back(std::move(task));
+        handle.resume();
+    }
+
+    // 运行直到所有顶层任务结束, 任务中抛出的异常会在这里重新抛出
+    void Run()
+    {
+        while (true)
+        {
+            for (auto it = m_tasks.begin(); it != m_tasks.end();)
+            {
+                if (it->IsDone())
+                {
+                    Task task = std::move(*it);
+                    it = m_tasks.erase(it);
+                    task.await_resume();
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if (m_tasks.empty())
+                break;
+
+            if (m_pending == 0)
+                throw std::runtime_error("EventLoop deadlock: no pending events");
+
+            struct kevent events[16];
+            int count = kevent(m_kq, nullptr, 0, events, 16, nullptr);
+            if (count == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("kevent failure: " + std::to_string(errno));
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                if (events[i].filter == EVFILT_USER)
+                {
+                    std::vector<std::coroutine_handle<>> posted;
+                    {
+                        std::lock_guard<std::mutex> lock(m_postedMutex);
+                        posted.swap(m_posted);
+                    }
+                    for (auto handle : posted)
+                    {
+                        m_pending--;
+                        handle.resume();
+                    }
+                    continue;
+                }
+
+                if (events[i].filter == EVFILT_READ)
+                    m_readWaiters.erase((int)events[i].ident);
+
+                m_pending--;
+                std::coroutine_handle<>::from_address(events[i].udata).resume();
+            }
+        }
+    }
+};
+
+// 在单独的线程上阻塞等待 GL fence, 完成后通过 EventLoop::Post 恢复协程, 事件循环线程不需要轮询
+// 等待线程使用与渲染上下文共享的 CGL 上下文, 渲染线程需要在 co_await 之前 glFlush
+class GLFenceWaiter
+{
+private:
+    struct Waiter
+    {
+        GLsync sync = nullptr;
+        std::coroutine_handle<> handle;
+        bool failed = false;
+    };
+
+    EventLoop& m_loop;
+    CGLContextObj m_context = nullptr;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Waiter*> m_queue;
+    bool m_stop = false;
+
+    void run()
+    {
+        CGLSetCurrentContext(m_context);
+
+        while (true)
+        {
+            Waiter* waiter = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                if (m_stop)
+                    break;
+                waiter = m_queue.front();
+                m_queue.pop_front();
+            }
+
+            // 超时只是为了能响应退出, 不是轮询
+            GLenum status = GL_TIMEOUT_EXPIRED;
+            while (status == GL_TIMEOUT_EXPIRED)
+            {
+                status = glClientWaitSync(waiter->sync, 0, 100000000);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stop)
+                    break;
+            }
+            if (status == GL_TIMEOUT_EXPIRED)
+                break;
+
+            waiter->failed = status == GL_WAIT_FAILED;
+            m_loop.Post(waiter->handle);
+        }
+
+        CGLSetCurrentContext(nullptr);
+    }
+
+public:
+    struct Awaiter
+    {
+        GLFenceWaiter& owner;
+        Waiter waiter;
+
+        bool await_ready()
+        {
+            GLenum status = glClientWaitSync(waiter.sync, 0, 0);
+            return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter.handle = handle;
+            owner.m_loop.BeginExternalWait();
+            {
+                std::lock_guard<std::mutex> lock(owner.m_mutex);
+                owner.m_queue.push_back(&waiter);
+            }
+            owner.m_cv.notify_one();
+        }
+
+        void await_resume()
+        {
+            if (waiter.failed)
+                throw std::runtime_error("glClientWaitSync failure");
+        }
+    };
+
+    GLFenceWaiter(EventLoop& loop, CGLContextObj shareContext) : m_loop(loop)
+    {
+        CGLError errorCode = CGLCreateContext(CGLGetPixelFormat(shareContext), shareContext, &m_context);
+        if (errorCode != kCGLNoError)
+            throw std::runtime_error("CGLCreateContext failure");
+
+        m_thread = std::thread([this] { run(); });
+    }
+
+    ~GLFenceWaiter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+
+        CGLDestroyContext(m_context);
+        m_context = nullptr;
+    }
+
+    GLFenceWaiter(const GLFenceWaiter&) = delete;
+    GLFenceWaiter& operator=(const GLFenceWaiter&) = delete;
+
+    // 等待 fence 完成
+    Awaiter Wait(GLsync sync)
+    {
+        return Awaiter{*this, Waiter{sync}};
+    }
+};
@@ -0,0 +1,286 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// 帧完整性校验, 结构与 XXH3 的长输入路径相同: 8 路 64 位累加器, 每个条带 64 字节,
+// 每条 lane 只做 32x32->64 乘法, 可以直接映射到 SSE2 (_mm_mul_epu32) 和 NEON (vmlal_u32).
+// 密钥由常量生成, 输出与参考 XXH3 不兼容, 仅用于同一程序的生产者和消费者之间校验
+class FrameHasher
+{
+private:
+    static constexpr uint64_t PRIME32_1 = 0x9E3779B1ULL;
+    static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+
+    static constexpr size_t STRIPE_SIZE = 64;
+    static constexpr size_t STRIPES_PER_BLOCK = 16;
+    static constexpr size_t SECRET_WORDS = STRIPES_PER_BLOCK + 8;
+    static constexpr size_t PREFETCH_DISTANCE = 1024;  // 帧数据远大于缓存, 提前预取让哈希跑满内存带宽
+
+    struct Secret
+    {
+        uint64_t words[SECRET_WORDS];
+    };
+
+    static constexpr Secret makeSecret()
+    {
+        // splitmix64
+        Secret secret{};
+        uint64_t x = PRIME64_3;
+        for (size_t i = 0; i < SECRET_WORDS; i++)
+        {
+            x += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            secret.words[i] = z ^ (z >> 31);
+        }
+        return secret;
+    }
+
+    static const uint64_t* getSecret()
+    {
+        static constexpr Secret SECRET = makeSecret();
+        return SECRET.words;
+    }
+
+    alignas(16) uint64_t m_acc[8];
+    uint8_t m_buffer[STRIPE_SIZE];
+    size_t m_bufferSize = 0;
+    size_t m_stripe = 0;
+    uint64_t m_totalSize = 0;
+
+    static uint64_t read64(const uint8_t* p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t mix(uint64_t a, uint64_t b)
+    {
+        __uint128_t product = (__uint128_t)a * b;
+        return (uint64_t)product ^ (uint64_t)(product >> 64);
+    }
+
+#if defined(__SSE2__)
+    static __m128i accumulateLane(__m128i acc, const uint8_t* p, const uint64_t* secret)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)p);
+        __m128i key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)secret));
+        __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        return _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+    }
+#elif defined(__ARM_NEON)
+    static uint64x2_t accumulateLane(uint64x2_t acc, const uint8_t* p, const uint64_t* secret)
+    {
+        uint64x2_t data = vreinterpretq_u64_u8(vld1q_u8(p));
+        uint64x2_t key = veorq_u64(data, vld1q_u64(secret));
+        acc = vaddq_u64(acc, vextq_u64(data, data, 1));
+        return vmlal_u32(acc, vmovn_u64(key), vshrn_n_u64(key, 32));
+    }
+#endif
+
+    // 累加 count 个条带, 第 i 个条带使用 secret[i..i+7]
+    static void accumulate(uint64_t* acc, const uint8_t* p, size_t count, const uint64_t* secret)
+    {
+#if defined(__SSE2__)
+        // 4 个累加器手动展开, 保证整个循环都留在寄存器里
+        __m128i a0 = _mm_load_si128((const __m128i*)acc + 0);
+        __m128i a1 = _mm_load_si128((const __m128i*)acc + 1);
+        __m128i a2 = _mm_load_si128((const __m128i*)acc + 2);
+        __m128i a3 = _mm_load_si128((const __m128i*)acc + 3);
+
+        for (size_t n = 0; n < count; n++, p += STRIPE_SIZE, secret++)
+        {
+            __builtin_prefetch(p + PREFETCH_DISTANCE);
+            a0 = accumulateLane(a0, p, secret);
+            a1 = accumulateLane(a1, p + 16, secret + 2);
+            a2 = accumulateLane(a2, p + 32, secret + 4);
+            a3 = accumulateLane(a3, p + 48, secret + 6);
+        }
+
+        _mm_store_si128((__m128i*)acc + 0, a0);
+        _mm_store_si128((__m128i*)acc + 1, a1);
+        _mm_store_si128((__m128i*)acc + 2, a2);
+        _mm_store_si128((__m128i*)acc + 3, a3);
+#elif defined(__ARM_NEON)
+        uint64x2_t a0 = vld1q_u64(acc + 0);
+        uint64x2_t a1 = vld1q_u64(acc + 2);
+        uint64x2_t a2 = vld1q_u64(acc + 4);
+        uint64x2_t a3 = vld1q_u64(acc + 6);
+
+        for (size_t n = 0; n < count; n++, p += STRIPE_SIZE, secret++)
+        {
+            __builtin_prefetch(p + PREFETCH_DISTANCE);
+            a0 = accumulateLane(a0, p, secret);
+            a1 = accumulateLane(a1, p + 16, secret + 2);
+            a2 = accumulateLane(a2, p + 32, secret + 4);
+            a3 = accumulateLane(a3, p + 48, secret + 6);
+        }
+
+        vst1q_u64(acc + 0, a0);
+        vst1q_u64(acc + 2, a1);
+        vst1q_u64(acc + 4, a2);
+        vst1q_u64(acc + 6, a3);
+#else
+        for (size_t n = 0; n < count; n++, p += STRIPE_SIZE, secret++)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                uint64_t data = read64(p + 8 * i);
+                uint64_t key = data ^ secret[i];
+                acc[i ^ 1] += data;
+                acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+            }
+        }
+#endif
+    }
+
+    // 每个块结束时打散累加器, 避免乘法结果只落在低位
+    static void scramble(uint64_t* acc, const uint64_t* secret)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            uint64_t a = acc[i];
+            a ^= a >> 47;
+            a ^= secret[i];
+            acc[i] = a * PRIME32_1;
+        }
+    }
+
+    void consume(const uint8_t* p, size_t count)
+    {
+        while (count > 0)
+        {
+            size_t n = STRIPES_PER_BLOCK - m_stripe;
+            if (n > count)
+                n = count;
+
+            accumulate(m_acc, p, n, getSecret() + m_stripe);
+            p += n * STRIPE_SIZE;
+            count -= n;
+            m_stripe += n;
+
+            if (m_stripe == STRIPES_PER_BLOCK)
+            {
+                scramble(m_acc, getSecret() + STRIPES_PER_BLOCK);
+                m_stripe = 0;
+            }
+        }
+    }
+
+public:
+    FrameHasher()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        m_acc[0] = PRIME32_1;
+        m_acc[1] = PRIME64_1;
+        m_acc[2] = PRIME64_2;
+        m_acc[3] = PRIME64_3;
+        m_acc[4] = PRIME64_1 ^ PRIME64_2;
+        m_acc[5] = PRIME64_2 ^ PRIME64_3;
+        m_acc[6] = PRIME64_3 ^ PRIME64_1;
+        m_acc[7] = PRIME32_1 ^ PRIME64_3;
+        m_bufferSize = 0;
+        m_stripe = 0;
+        m_totalSize = 0;
+    }
+
+    void Update(const void* data, size_t size)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        m_totalSize += size;
+
+        if (m_bufferSize > 0)
+        {
+            size_t fill = STRIPE_SIZE - m_bufferSize;
+            if (fill > size)
+                fill = size;
+            memcpy(m_buffer + m_bufferSize, p, fill);
+            m_bufferSize += fill;
+            p += fill;
+            size -= fill;
+
+            if (m_bufferSize < STRIPE_SIZE)
+                return;
+
+            consume(m_buffer, 1);
+            m_bufferSize = 0;
+        }
+
+        size_t count = size / STRIPE_SIZE;
+        consume(p, count);
+        p += count * STRIPE_SIZE;
+        size -= count * STRIPE_SIZE;
+
+        memcpy(m_buffer, p, size);
+        m_bufferSize = size;
+    }
+
+    uint64_t Digest() const
+    {
+        alignas(16) uint64_t acc[8];
+        memcpy(acc, m_acc, sizeof(acc));
+
+        // 剩余不足一个条带的数据补零, 长度在最后混入
+        if (m_bufferSize > 0)
+        {
+            uint8_t last[STRIPE_SIZE] = {};
+            memcpy(last, m_buffer, m_bufferSize);
+            accumulate(acc, last, 1, getSecret() + m_stripe);
+        }
+
+        uint64_t h = m_totalSize * PRIME64_1;
+        for (int i = 0; i < 4; i++)
+        {
+            h += mix(acc[2 * i] ^ getSecret()[2 * i + 1], acc[2 * i + 1] ^ getSecret()[2 * i + 2]);
+        }
+
+        h ^= h >> 37;
+        h *= 0x165667919E3779F9ULL;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+// 生产者随帧写入的校验信息, 按 seqlock 方式使用:
+// 开始渲染第 N 帧前写入 sequence = 2N - 1 (奇数表示正在写), 渲染完成后写入 sequence = 2N 和哈希
+struct FrameStamp
+{
+    uint64_t sequence = 0;
+    uint64_t hash = 0;
+
+    bool IsWriting() const
+    {
+        return (sequence & 1) != 0;
+    }
+
+    uint64_t GetFrameNumber() const
+    {
+        return (sequence + 1) / 2;
+    }
+};
+
+// 消费者侧的统计
+struct FrameStats
+{
+    uint64_t verified = 0;  // 完整且是新的帧
+    uint64_t torn = 0;      // 读的过程中生产者在写, 或哈希不一致
+    uint64_t stale = 0;     // 完整但帧号没有变化
+    uint64_t dropped = 0;   // 帧号跳过的帧数
+    uint64_t lastFrameNumber = 0;
+    double hashTime = 0;    // 加锁和哈希的总耗时, 毫秒
+};
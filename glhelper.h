@@ -1,5 +1,8 @@
 #pragma once
+#include <cstring>
+#include <functional>
 #include <string>
+#include <vector>
 #include <OpenGL/OpenGL.h>
 #include <OpenGL/gl3.h>
 
@@ -65,6 +68,8 @@ int GetFormatSize(GLenum format)
         return 3;
     case GL_RGBA:
     case GL_RGBA_INTEGER:
+    case GL_BGRA:
+    case GL_BGRA_INTEGER:
         return 4;
     default:
         return 0;
@@ -159,3 +164,182 @@ public:
         GL_CHECK(glDeleteFramebuffers(1, &fbo));
     }
 };
+
+// 异步读回: 请求通过 PBO 排队, 若干帧后 fence 完成时在 Poll 中回调, 不阻塞 GPU 管线
+class GLReadback
+{
+public:
+    // buffer 来自复用池, 回调返回后归还; 需要保留数据时可以 swap 走
+    using Callback = std::function<void(std::vector<unsigned char>& buffer, int width, int height)>;
+
+private:
+    struct Pending
+    {
+        GLuint pbo = 0;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+        int width = 0;
+        int height = 0;
+        size_t size = 0;
+        Callback callback;
+    };
+
+    std::vector<Pending> m_ring;
+    size_t m_head = 0;
+    size_t m_count = 0;
+    GLuint m_fbo = 0;
+    std::vector<std::vector<unsigned char>> m_pool;
+
+    void complete(Pending& request)
+    {
+        std::vector<unsigned char> buffer;
+        if (!m_pool.empty())
+        {
+            buffer = std::move(m_pool.back());
+            m_pool.pop_back();
+        }
+        buffer.resize(request.size);
+
+        // 回调或 GL 调用抛出异常时也要把缓冲区还回池里
+        struct PoolReturn
+        {
+            std::vector<std::vector<unsigned char>>& pool;
+            std::vector<unsigned char>& buffer;
+
+            ~PoolReturn()
+            {
+                pool.push_back(std::move(buffer));
+            }
+        } poolReturn{m_pool, buffer};
+
+        GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, request.pbo));
+        void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, request.size, GL_MAP_READ_BIT);
+        if (data != nullptr)
+        {
+            memcpy(buffer.data(), data, request.size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+        glDeleteSync(request.fence);
+        request.fence = nullptr;
+
+        Callback callback = std::move(request.callback);
+        request.callback = nullptr;
+
+        if (data == nullptr)
+            throw std::runtime_error("glMapBufferRange failure");
+
+        callback(buffer, request.width, request.height);
+    }
+
+    // 按提交顺序完成最早的请求, wait 为 false 时只处理已经完成的
+    bool completeOldest(bool wait)
+    {
+        Pending& request = m_ring[(m_head + m_ring.size() - m_count) % m_ring.size()];
+
+        GLenum status = glClientWaitSync(request.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+        if (status == GL_WAIT_FAILED)
+            throw std::runtime_error("glClientWaitSync failure");
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+
+        m_count--;
+        complete(request);
+        return true;
+    }
+
+public:
+    GLReadback(int depth = 3)
+    {
+        m_ring.resize(depth > 0 ? depth : 1);
+    }
+
+    ~GLReadback()
+    {
+        for (auto& request : m_ring)
+        {
+            if (request.fence != nullptr)
+                glDeleteSync(request.fence);
+            if (request.pbo != 0)
+                glDeleteBuffers(1, &request.pbo);
+        }
+        if (m_fbo != 0)
+        {
+            glDeleteFramebuffers(1, &m_fbo);
+            m_fbo = 0;
+        }
+    }
+
+    GLReadback(const GLReadback&) = delete;
+    GLReadback& operator=(const GLReadback&) = delete;
+
+    size_t GetPendingCount() const
+    {
+        return m_count;
+    }
+
+    // 提交读回请求, 队列已满时等待最早的请求完成
+    void Request(const GLTexture& texture, int width, int height, Callback callback)
+    {
+        int formatSize = GetFormatSize(texture.GetFormat());
+        if (formatSize == 0)
+            throw std::runtime_error("unsupported readback format: " + std::to_string(texture.GetFormat()));
+
+        if (m_count == m_ring.size())
+            completeOldest(true);
+
+        if (m_fbo == 0)
+            GL_CHECK(glGenFramebuffers(1, &m_fbo));
+
+        Pending& request = m_ring[m_head];
+        request.width = width;
+        request.height = height;
+        request.size = (size_t)width * height * formatSize;
+        request.callback = std::move(callback);
+
+        if (request.pbo == 0)
+            GL_CHECK(glGenBuffers(1, &request.pbo));
+
+        GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, request.pbo));
+        if (request.capacity < request.size)
+        {
+            GL_CHECK(glBufferData(GL_PIXEL_PACK_BUFFER, request.size, nullptr, GL_STREAM_READ));
+            request.capacity = request.size;
+        }
+
+        GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo));
+        GL_CHECK(glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture.GetTarget(), texture.GetTexture(), 0));
+
+        GLint packAlignment = 4;
+        GL_CHECK(glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment));
+        GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GL_CHECK(glReadPixels(0, 0, width, height, texture.GetFormat(), GL_UNSIGNED_BYTE, (void*)0));
+        GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, packAlignment));
+
+        GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, GL_NONE));
+        GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+        request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        m_head = (m_head + 1) % m_ring.size();
+        m_count++;
+    }
+
+    // 每帧调用一次, 回调所有已完成的请求
+    void Poll()
+    {
+        while (m_count > 0 && completeOldest(false))
+        {
+        }
+    }
+
+    // 等待并回调所有未完成的请求
+    void Flush()
+    {
+        while (m_count > 0)
+        {
+            completeOldest(true);
+        }
+    }
+};
@@ -1,16 +1,87 @@
 #include <chrono>
 #include <string>
 #include <unistd.h>
-#include <thread>
 
 #include "renderer.h"
 #include "IOSurfaceTexture.h"
+#include "eventloop.h"
 
 using namespace std::literals::chrono_literals;
 
+Task renderLoop(EventLoop& loop, CGLContextObj context, IOSurfaceRef surface, bool integrity)
+{
+    std::shared_ptr<IOSurfaceTexture> surfaceTexture;
+    std::shared_ptr<IRenderer> renderer;
+    uint64_t frameNumber = 0;
+    double publishTime = 0;
+    GLFenceWaiter fenceWaiter(loop, context);
+
+    while (true)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        CGLError errorCode = CGLSetCurrentContext(context);
+        if (errorCode != kCGLNoError)
+            throw std::runtime_error("CGLSetCurrentContext failure");
+
+        if (renderer == nullptr)
+        {
+            // 创建渲染器
+            renderer = std::make_shared<TestRenderer>();
+            renderer->Init();
+
+            surfaceTexture = std::make_shared<IOSurfaceTexture>(surface);
+        }
+
+        GLuint framebuffer;
+        GL_CHECK(glGenFramebuffers(1, &framebuffer));
+        GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+        GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, surfaceTexture->GetTarget(), surfaceTexture->GetTexture(), 0));
+
+        // 开始写入前先标记, 消费者据此判断读到的是否是写了一半的帧
+        if (integrity)
+        {
+            surfaceTexture->BeginFrame(++frameNumber);
+        }
+
+        GL_CHECK(glViewport(0, 0, surfaceTexture->GetWidth(), surfaceTexture->GetHeight()));
+        GL_CHECK(glClearColor(1.0f, 0.0f, 0.0f, 1.0f));
+        GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
+
+        renderer->OnRender();
+
+        // 用 fence 代替 glFinish, 等待 GPU 期间线程可以处理其他事件
+        {
+            std::unique_ptr<std::remove_pointer_t<GLsync>, decltype(&glDeleteSync)> fence(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), glDeleteSync);
+            GL_CHECK(glFlush());
+            co_await fenceWaiter.Wait(fence.get());
+        }
+
+        // 帧完整后写入帧号和哈希, 供消费者校验
+        if (integrity)
+        {
+            auto publishStart = std::chrono::high_resolution_clock::now();
+            surfaceTexture->PublishFrame(frameNumber);
+            publishTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - publishStart).count();
+        }
+
+        GL_CHECK(glDeleteFramebuffers(1, &framebuffer));
+
+        CGLFlushDrawable(context);
+
+        // Calculate frame rate
+        co_await loop.Sleep(std::chrono::milliseconds(1000 / 60) - (std::chrono::high_resolution_clock::now() - startTime));
+
+        printf("server elapsedTime: %.2f ms, publishTime: %.3f ms\n", (float)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime).count(), publishTime);
+    }
+
+    renderer->UnInit();
+}
+
 int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[])
 {
     IOSurfaceRef surface = NULL;
+    bool integrity = argc > 2 && std::string(argv[2]) == "--integrity";
 
     if (argc > 1)
     {
@@ -26,7 +97,7 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[])
     }
     else
     {
-        printf("Usage: %s <surfaceID>\n", argv[0]);
+        printf("Usage: %s <surfaceID> [--integrity]\n", argv[0]);
         return -1;
     }
 
@@ -52,60 +123,9 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[])
         CGLDestroyPixelFormat(pix);
     }
 
-    std::shared_ptr<IOSurfaceTexture> surfaceTexture;
-    std::shared_ptr<IRenderer> renderer;
-
-    while (true)
-    {
-        auto startTime = std::chrono::high_resolution_clock::now();
-
-        CGLError errorCode = CGLSetCurrentContext(context);
-        if (errorCode != kCGLNoError)
-            throw std::runtime_error("CGLSetCurrentContext failure");
-
-        if (renderer == nullptr)
-        {
-            // 创建渲染器
-            renderer = std::make_shared<TestRenderer>();
-            renderer->Init();
-
-            surfaceTexture = std::make_shared<IOSurfaceTexture>(surface);
-        }
-
-        errorCode = CGLSetCurrentContext(context);
-        if (errorCode != kCGLNoError)
-            throw std::runtime_error("CGLSetCurrentContext failure");
-
-        GLuint framebuffer;
-        GL_CHECK(glGenFramebuffers(1, &framebuffer));
-        GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
-        GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, surfaceTexture->GetTarget(), surfaceTexture->GetTexture(), 0));
-
-        GL_CHECK(glViewport(0, 0, surfaceTexture->GetWidth(), surfaceTexture->GetHeight()));
-        GL_CHECK(glClearColor(1.0f, 0.0f, 0.0f, 1.0f));
-        GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
-
-        renderer->OnRender();
-
-        GL_CHECK(glFinish());
-        GL_CHECK(glFlush());
-
-        GL_CHECK(glDeleteFramebuffers(1, &framebuffer));
-
-        CGLFlushDrawable(context);
-
-        // Calculate frame rate
-        auto endTime = std::chrono::high_resolution_clock::now();
-        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
-        if (elapsedTime < 1000 / 60)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000 / 60 - elapsedTime));
-        }
-
-        printf("server elapsedTime: %.2f ms\n", (float)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime).count());
-    }
-
-    renderer->UnInit();
+    EventLoop loop;
+    loop.Spawn(renderLoop(loop, context, surface, integrity));
+    loop.Run();
 
     CFRelease(surface);
 